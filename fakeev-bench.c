@@ -0,0 +1,100 @@
+// Benchmark the fakeev I/O engines without real devices..
+// a child process feeds synthetic frames (X, Y, SYN) into a pipe standing
+// in for the real device, another drains a pipe standing in for /dev/uinput
+// and checks frames arrive complete & in order. Pipes are not evdev/uinput,
+// so treat the numbers as a comparison of the engines, not of real devices.
+
+#define _GNU_SOURCE
+#define main fakeev_main
+#include "fakeev.c"
+#undef main
+#include <sys/wait.h>
+
+static void feed(int fd, int nframes, int pace) {
+    for (int f=0; f<nframes; f++) {
+        struct input_event evts[3];
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        set_event(evts, &now, EV_ABS, ABS_X, 100+f%800);
+        set_event(evts+1, &now, EV_ABS, ABS_Y, 900-f%800);
+        set_event(evts+2, &now, EV_SYN, SYN_REPORT, 0);
+        if (write(fd, evts, sizeof(evts))!=sizeof(evts)) {
+            perror("feeding events");
+            exit(1);
+        }
+        if (pace)
+            usleep(pace);
+    }
+}
+
+static void drain(int fd, int nframes) {
+    struct input_event evts[256];
+    long n = 0, syns = 0, backwards = 0;
+    __s32 lastx = -1;
+    int r;
+    while ((r=read(fd, evts, sizeof(evts)))>0) {
+        for (int i=0; i<r/(int)sizeof(evts[0]); i++, n++) {
+            if (EV_SYN==evts[i].type)
+                syns++;
+            if (EV_ABS==evts[i].type && ABS_X==evts[i].code) {
+                if (evts[i].value<lastx)
+                    backwards++;
+                lastx = evts[i].value;
+            }
+        }
+    }
+    // X wraps every 800 frames, any more steps backwards are out of order
+    fprintf(stderr, "sink: events=%ld frames=%ld out-of-order=%ld\n", n, syns,
+        backwards>(nframes-1)/800 ? backwards-(nframes-1)/800 : 0);
+}
+
+int main(int argc, char **argv) {
+    if (argc<4 || (strcmp(argv[1],"read")!=0 && strcmp(argv[1],"uring")!=0))
+        return printf("usage: %s <read|uring> <frames> <usecs between frames, 0=flood>\n", argv[0]);
+    int nframes = atoi(argv[2]);
+    int pace = atoi(argv[3]);
+    int in[2], out[2];
+    if (pipe(in)<0 || pipe(out)<0) {
+        perror("pipe");
+        return 1;
+    }
+    if (!fork()) {
+        close(in[0]); close(out[0]); close(out[1]);
+        feed(in[1], nframes, pace);
+        return 0;
+    }
+    if (!fork()) {
+        close(in[0]); close(in[1]); close(out[1]);
+        drain(out[0], nframes);
+        return 0;
+    }
+    close(in[1]);
+    close(out[0]);
+    // like /dev/uinput: non-blocking, and roomy enough not to overflow
+    fcntl(out[1], F_SETPIPE_SZ, 1<<20);
+    fcntl(out[1], F_SETFL, O_NONBLOCK);
+    static deadzone_t zones[ABS_CNT];
+    for (int a=0; a<ABS_CNT; a++) {
+        zones[a].min = 0;
+        zones[a].max = 1023;
+        zones[a].dlow = 500;
+        zones[a].dhigh = 524;
+    }
+    fakeev_t fe;
+    memset(&fe, 0, sizeof(fe));
+    fe.evfd = in[0];
+    fe.uifd = out[1];
+    fe.backgnd = 1;
+    fe.zones = zones;
+    if (strcmp(argv[1], "uring")==0) {
+        if (uring_engine(&fe)<0)
+            return 1;
+    } else {
+        read_engine(&fe);
+    }
+    show_stats(&fe, argv[1]);
+    close(out[1]);
+    while (wait(NULL)>0)
+        ;
+    return 0;
+}
@@ -16,6 +16,12 @@
 #include <signal.h>
 #include <time.h>
 #include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
 
 // raw joystick state
 typedef struct {
@@ -47,28 +53,628 @@ static __s32 deadzone(deadzone_t *zones, int axis, __s32 value) {
     return rv;
 }
 
-static int send_event(int uifd, __u16 type, __u16 code, __s32 value) {
-    struct input_event evt;
-    gettimeofday(&evt.time, NULL);
-    evt.type = type;
-    evt.code = code;
-    evt.value = value;
-    if (write(uifd, &evt, sizeof(evt))!=sizeof(evt)) {
-        if (EAGAIN==errno) {
-            puts("uinput overflow");
-        } else {
-            perror("writing uinput");
+// cached device profile: everything we copy to the fake device at startup,
+// keyed by real device id, name & ev/abs/key bitmaps, so we can skip probing
+// on next run.
+// The cache file is a plain sequence of these records.
+#define PROFILE_MAGIC   0x50564546  // 'FEVP'
+#define PROFILE_VERSION 1
+#define PROFILE_BITS    4           // ev, abs, key, prop bitmaps (see blist below)
+#define PROFILE_KEYBITS 3           // ev, abs, key bitmaps are part of the key
+
+typedef struct {
+    __u32 magic;
+    __u32 version;
+    struct input_id id;
+    char name[128];
+    __u8 bits[PROFILE_BITS][KEY_CNT/8];
+    struct input_absinfo absinfo[ABS_CNT];
+    deadzone_t zones[ABS_CNT];
+} profile_t;
+
+// bitmaps we copy, and the uinput ioctl to replay each one
+static const int blist[PROFILE_BITS] = {0, EV_ABS, EV_KEY, EV_MAX};
+static const int uiioc[PROFILE_BITS] = {UI_SET_EVBIT, UI_SET_ABSBIT, UI_SET_KEYBIT, UI_SET_PROPBIT};
+
+#define TESTBIT(b, o) ((b)[(o)/8] & (1<<((o)%8)))
+
+static int profile_match(profile_t *a, profile_t *b) {
+    return a->magic==PROFILE_MAGIC && a->version==PROFILE_VERSION &&
+        memcmp(&a->id, &b->id, sizeof(a->id))==0 &&
+        memcmp(a->name, b->name, sizeof(a->name))==0 &&
+        memcmp(a->bits, b->bits, PROFILE_KEYBITS*sizeof(a->bits[0]))==0;
+}
+
+// look for a record matching the key fields (id, name, ev/abs/key bits) of prof,
+// copy it over prof if found. Returns 1 on hit, 0 on miss.
+static int load_profile(char *path, profile_t *prof) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return 0;
+    profile_t rec;
+    int hit = 0;
+    while (!hit && fread(&rec, sizeof(rec), 1, fp)==1) {
+        if (profile_match(&rec, prof)) {
+            memcpy(prof, &rec, sizeof(rec));
+            hit = 1;
+        }
+    }
+    fclose(fp);
+    return hit;
+}
+
+// rewrite the cache file with prof replacing any older record for the same device
+static int save_profile(char *path, profile_t *prof) {
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd<0)
+        return -1;
+    FILE *out = fdopen(fd, "wb");
+    if (!out) {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    FILE *in = fopen(path, "rb");
+    profile_t rec;
+    int rv = 0;
+    while (in && fread(&rec, sizeof(rec), 1, in)==1) {
+        if (!profile_match(&rec, prof) && rec.magic==PROFILE_MAGIC && rec.version==PROFILE_VERSION)
+            rv |= fwrite(&rec, sizeof(rec), 1, out)!=1;
+    }
+    if (in)
+        fclose(in);
+    rv |= fwrite(prof, sizeof(*prof), 1, out)!=1;
+    rv |= fclose(out)!=0;
+    if (rv || rename(tmp, path)<0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// read axis info & derive deadzones from the real device, returns 1 if any
+// ranges differ from what was in prof already (eg: recalibrated), -1 on error
+static int probe_axes(int evfd, profile_t *prof) {
+    int changed = 0;
+    for (int a=0; a<ABS_CNT; a++) {
+        if (TESTBIT(prof->bits[1], a)) {
+            struct input_absinfo *ai = prof->absinfo+a;
+            struct input_absinfo old = *ai;
+            if (ioctl(evfd, EVIOCGABS(a), ai)<0) {
+                perror("reading axis info");
+                return -1;
+            }
+            if (old.minimum!=ai->minimum || old.maximum!=ai->maximum || old.fuzz!=ai->fuzz ||
+                old.flat!=ai->flat || old.resolution!=ai->resolution)
+                changed = 1;
+            prof->zones[a].min = ai->minimum;
+            prof->zones[a].max = ai->maximum;
+            prof->zones[a].dlow = (ai->minimum+ai->maximum)/2-ai->flat;
+            prof->zones[a].dhigh = (ai->minimum+ai->maximum)/2+ai->flat;
+        }
+    }
+    return changed;
+}
+
+// read the cache key fields (id, name, ev/abs/key bits) from the real device
+static int read_key(int evfd, profile_t *prof) {
+    int nlen=ioctl(evfd, EVIOCGNAME(sizeof(prof->name)), prof->name);
+    if (nlen<0) {
+        perror("reading device name");
+        return -1;
+    }
+    printf("real device name: %.*s\n", nlen, prof->name);
+    if (ioctl(evfd, EVIOCGID, &prof->id)<0) {
+        perror("reading real bus id");
+        return -1;
+    }
+    for (int b=0; b<PROFILE_KEYBITS; b++) {
+        if (ioctl(evfd, EVIOCGBIT(blist[b],sizeof(prof->bits[b])), prof->bits[b])<0) {
+            perror("reading real device bits");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// read remaining capabilities, axis info & derive deadzones from the real
+// device, expects the key fields to be populated already by read_key()
+static int probe_profile(int evfd, profile_t *prof) {
+    for (int b=PROFILE_KEYBITS; b<PROFILE_BITS; b++) {
+        int blen;
+        if (EV_MAX==blist[b])
+            blen = ioctl(evfd, EVIOCGPROP(sizeof(prof->bits[b])), prof->bits[b]);
+        else
+            blen = ioctl(evfd, EVIOCGBIT(blist[b],sizeof(prof->bits[b])), prof->bits[b]);
+        if (blen<0) {
+            perror("reading real device bits");
             return -1;
         }
     }
+    if (probe_axes(evfd, prof)<0)
+        return -1;
+    prof->magic = PROFILE_MAGIC;
+    prof->version = PROFILE_VERSION;
+    return 0;
+}
+
+// replay a profile into the (not yet created) fake device
+static int apply_profile(int uifd, profile_t *prof, int verbose) {
+    for (int b=0; b<PROFILE_BITS; b++) {
+        if (verbose) printf("copy bits(%d): ", blist[b]);
+        for (int o=0; o<(int)sizeof(prof->bits[b])*8; o++) {
+            if (TESTBIT(prof->bits[b], o)) {
+                if (verbose) printf("%02x,", o);
+                if (ioctl(uifd, uiioc[b], o)<0) {
+                    perror("ioctl(UI_SET_XX)");
+                    return -1;
+                }
+            }
+        }
+        if (verbose) puts("");
+    }
+    for (int a=0; a<ABS_CNT; a++) {
+        if (TESTBIT(prof->bits[1], a)) {
+            struct uinput_abs_setup abs_setup;
+            abs_setup.code = a;
+            abs_setup.absinfo = prof->absinfo[a];
+            if (ioctl(uifd, UI_ABS_SETUP, &abs_setup)<0) {
+                perror("ioctl(UI_ABS_SETUP)");
+                return -1;
+            }
+            if (verbose) printf("axis[%d]: min=%d max=%d fuzz=%d flat=%d: dlow=%d dhigh=%d\n", a,
+                abs_setup.absinfo.minimum,
+                abs_setup.absinfo.maximum,
+                abs_setup.absinfo.fuzz,
+                abs_setup.absinfo.flat,
+                prof->zones[a].dlow, prof->zones[a].dhigh);
+        }
+    }
+    return 0;
+}
+
+// filter state, shared by both I/O engines
+typedef struct {
+    int evfd;
+    int uifd;
+    int backgnd;
+    deadzone_t *zones;
+    joystate_t joy;             // accumulated from real device
+    joystate_t pjoy;            // last values pushed to fake device
+    // engine statistics (-s)
+    unsigned long events;
+    unsigned long frames;
+    unsigned long syscalls;
+    double lat_sum;             // real sync event -> uinput write complete (ms), per frame
+    double lat_max;
+    unsigned long lat_cnt;
+} fakeev_t;
+
+// worst case number of events in one pushed frame
+#define FRAME_MAX (ABS_CNT+KEY_CNT+1)
+
+// update accumulated state from a real event, returns 1 on sync
+static int accumulate(fakeev_t *fe, struct input_event *evt) {
+    fe->events++;
+    switch (evt->type) {
+    // drop through to sync logic
+    case EV_SYN:
+        return 1;
+    // update accumulated state, go round again
+    case EV_ABS:
+        fe->joy.axes[evt->code % ABS_CNT] = evt->value;
+        return 0;
+    case EV_KEY:
+        fe->joy.keys[evt->code % KEY_CNT] = (__u8)evt->value;
+        return 0;
+    // siliently ignore these, we get one after each key press/release
+    case EV_MSC:
+        return 0;
+    // eh?
+    default:
+        printf("ignored event: type=0x%x code=0x%x value=%d\n", evt->type, evt->code, evt->value);
+        return 0;
+    }
+}
+
+static void set_event(struct input_event *evt, struct timeval *tv, __u16 type, __u16 code, __s32 value) {
+    evt->time = *tv;
+    evt->type = type;
+    evt->code = code;
+    evt->value = value;
+}
+
+// EV_SYN arrived: check for offline, if not append all modified values
+// and a SYN to out[] (room for FRAME_MAX), returns number appended
+static int sync_frame(fakeev_t *fe, struct input_event *out) {
+    joystate_t *joy = &fe->joy, *pjoy = &fe->pjoy;
+    // check for magic offline values
+    // X & Y within +/-2 of centre (512), rudder centre (128) throttle full (0)
+    if (510<=joy->axes[ABS_X] && joy->axes[ABS_X]<=514 &&
+        510<=joy->axes[ABS_Y] && joy->axes[ABS_Y]<=514 &&
+        128==joy->axes[ABS_RZ] && 0==joy->axes[ABS_THROTTLE]) {
+        joy->offline = 1;
+        return 0;
+    }
+    joy->offline = 0;
+    // collect modified values
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int n = 0;
+    for (int a=0; a<ABS_CNT; a++) {
+        if (pjoy->axes[a] != joy->axes[a]) {
+            pjoy->axes[a] = joy->axes[a];
+            set_event(out+n++, &now, EV_ABS, a, deadzone(fe->zones, a, pjoy->axes[a]));
+        }
+    }
+    for (int k=0; k<KEY_CNT; k++) {
+        if (pjoy->keys[k] != joy->keys[k]) {
+            pjoy->keys[k] = joy->keys[k];
+            set_event(out+n++, &now, EV_KEY, k, pjoy->keys[k]);
+        }
+    }
+    // SYN to flush out
+    set_event(out+n++, &now, EV_SYN, SYN_REPORT, 0);
+    fe->frames++;
+    return n;
+}
+
+// push a frame through uinput, one event per write
+static int send_frame(fakeev_t *fe, struct input_event *evts, int n) {
+    for (int i=0; i<n; i++) {
+        fe->syscalls++;
+        if (write(fe->uifd, evts+i, sizeof(evts[i]))!=sizeof(evts[i])) {
+            if (EAGAIN==errno) {
+                puts("uinput overflow");
+            } else {
+                perror("writing uinput");
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// record latency from real event timestamp to write completion (now if NULL)
+static void account_latency(fakeev_t *fe, struct timeval *evtime, struct timeval *at) {
+    struct timeval now;
+    if (!at) {
+        gettimeofday(&now, NULL);
+        at = &now;
+    }
+    double ms = (at->tv_sec-evtime->tv_sec)*1e3 + (at->tv_usec-evtime->tv_usec)/1e3;
+    fe->lat_sum += ms;
+    if (ms > fe->lat_max)
+        fe->lat_max = ms;
+    fe->lat_cnt++;
+}
+
+static void show_status(fakeev_t *fe) {
+    joystate_t *pjoy = &fe->pjoy;
+    deadzone_t *zones = fe->zones;
+    printf("X:%04d Y:%04d R:%03d T:%03d B:%d%d%d%d%d%d%d%d%d%d H:%c%c O:%d\r",
+        deadzone(zones, ABS_X, pjoy->axes[ABS_X]),
+        deadzone(zones, ABS_Y, pjoy->axes[ABS_Y]),
+        deadzone(zones, ABS_RZ, pjoy->axes[ABS_RZ]),
+        deadzone(zones, ABS_THROTTLE, pjoy->axes[ABS_THROTTLE]),
+        pjoy->keys[BTN_TRIGGER], pjoy->keys[BTN_THUMB], pjoy->keys[BTN_THUMB2],
+        pjoy->keys[BTN_TOP], pjoy->keys[BTN_TOP2], pjoy->keys[BTN_PINKIE],
+        pjoy->keys[BTN_BASE], pjoy->keys[BTN_BASE2], pjoy->keys[BTN_BASE3], pjoy->keys[BTN_BASE4],
+        '='+pjoy->axes[ABS_HAT0X], '='+pjoy->axes[ABS_HAT0Y], fe->joy.offline);
+    fflush(stdout);
+}
+
+static void show_stats(fakeev_t *fe, char *engine) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    double usr = ru.ru_utime.tv_sec*1e3 + ru.ru_utime.tv_usec/1e3;
+    double sys = ru.ru_stime.tv_sec*1e3 + ru.ru_stime.tv_usec/1e3;
+    unsigned long frames = fe->frames ? fe->frames : 1;
+    fprintf(stderr, "fakeev[%s]: events=%lu frames=%lu syscalls/frame=%.2f cpu/frame=%.1fus (usr=%.0fms sys=%.0fms) latency avg=%.3fms max=%.3fms\n",
+        engine, fe->events, fe->frames, (double)fe->syscalls/frames,
+        (usr+sys)*1e3/frames, usr, sys,
+        fe->lat_cnt ? fe->lat_sum/fe->lat_cnt : 0.0, fe->lat_max);
+}
+
+// classic engine: blocking read() of each event, write() of each event
+static void read_engine(fakeev_t *fe) {
+    static struct input_event frame[FRAME_MAX];
+    while (!done) {
+        struct input_event evt;
+        fe->syscalls++;
+        if (read(fe->evfd, &evt, sizeof(evt))!=sizeof(evt)) {
+            if (!done)
+                perror("reading event");
+            break;
+        }
+        if (!accumulate(fe, &evt))
+            continue;
+        // push modified values to uinput unless offline
+        int n = sync_frame(fe, frame);
+        if (n) {
+            if (send_frame(fe, frame, n))
+                done = 1;
+            else
+                account_latency(fe, &evt.time, NULL);
+        }
+        if (!fe->backgnd)
+            show_status(fe);
+    }
+}
+
+// minimal io_uring plumbing, raw syscalls so we don't need liburing
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned queued;            // SQEs not yet submitted
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_size, cq_size, sqes_size;
+} uring_t;
+
+static void uring_exit(uring_t *ur) {
+    if (ur->sqes)
+        munmap(ur->sqes, ur->sqes_size);
+    if (ur->cq_ring)
+        munmap(ur->cq_ring, ur->cq_size);
+    if (ur->sq_ring)
+        munmap(ur->sq_ring, ur->sq_size);
+    close(ur->fd);
+}
+
+static void *uring_mmap(uring_t *ur, size_t size, off_t off) {
+    void *p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ur->fd, off);
+    return MAP_FAILED==p ? NULL : p;
+}
+
+static int uring_init(uring_t *ur, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(ur, 0, sizeof(*ur));
+    ur->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ur->fd<0)
+        return -1;
+    ur->entries = p.sq_entries;
+    ur->sq_size = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    ur->cq_size = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    ur->sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+    ur->sq_ring = uring_mmap(ur, ur->sq_size, IORING_OFF_SQ_RING);
+    ur->cq_ring = uring_mmap(ur, ur->cq_size, IORING_OFF_CQ_RING);
+    ur->sqes = uring_mmap(ur, ur->sqes_size, IORING_OFF_SQES);
+    if (!ur->sq_ring || !ur->cq_ring || !ur->sqes) {
+        uring_exit(ur);
+        return -1;
+    }
+    ur->sq_head = (unsigned *)((char *)ur->sq_ring + p.sq_off.head);
+    ur->sq_tail = (unsigned *)((char *)ur->sq_ring + p.sq_off.tail);
+    ur->sq_mask = (unsigned *)((char *)ur->sq_ring + p.sq_off.ring_mask);
+    ur->sq_array = (unsigned *)((char *)ur->sq_ring + p.sq_off.array);
+    ur->cq_head = (unsigned *)((char *)ur->cq_ring + p.cq_off.head);
+    ur->cq_tail = (unsigned *)((char *)ur->cq_ring + p.cq_off.tail);
+    ur->cq_mask = (unsigned *)((char *)ur->cq_ring + p.cq_off.ring_mask);
+    ur->cqes = (struct io_uring_cqe *)((char *)ur->cq_ring + p.cq_off.cqes);
+    return 0;
+}
+
+// queue a request, read/write use the current file position
+static struct io_uring_sqe *uring_prep(uring_t *ur, __u8 op, int fd, void *addr, __u32 len, __u64 ud) {
+    unsigned tail = *ur->sq_tail;
+    if (tail - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE) >= ur->entries)
+        return NULL;
+    unsigned idx = tail & *ur->sq_mask;
+    struct io_uring_sqe *sqe = ur->sqes+idx;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)addr;
+    sqe->len = len;
+    sqe->off = (__u64)-1;
+    sqe->user_data = ud;
+    ur->sq_array[idx] = idx;
+    __atomic_store_n(ur->sq_tail, tail+1, __ATOMIC_RELEASE);
+    ur->queued++;
+    return sqe;
+}
+
+// check the kernel knows the opcodes we use (READ/WRITE/TIMEOUT need 5.6+)
+static int uring_probe(uring_t *ur) {
+    static const __u8 ops[] = {IORING_OP_READ, IORING_OP_WRITE, IORING_OP_TIMEOUT};
+    size_t size = sizeof(struct io_uring_probe) + 256*sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    int rv = probe ? 0 : -1;
+    if (probe && syscall(__NR_io_uring_register, ur->fd, IORING_REGISTER_PROBE, probe, 256)<0)
+        rv = -1;
+    for (size_t o=0; !rv && o<sizeof(ops); o++) {
+        if (ops[o]>probe->last_op || !(probe->ops[ops[o]].flags & IO_URING_OP_SUPPORTED)) {
+            errno = EOPNOTSUPP;
+            rv = -1;
+        }
+    }
+    free(probe);
+    return rv;
+}
+
+// submit anything queued and wait for completions
+static int uring_enter(uring_t *ur, unsigned wait) {
+    int rv = syscall(__NR_io_uring_enter, ur->fd, ur->queued, wait, IORING_ENTER_GETEVENTS, NULL, 0);
+    if (rv>0)
+        ur->queued -= rv;
+    return rv;
+}
+
+// io_uring engine: a pre-posted batch read on the real device, frames pushed
+// to uinput as async writes, Ctrl-C via signalfd & status line on a timer,
+// all through one ring - one io_uring_enter() per wakeup. Both device fds are
+// O_NONBLOCK, so the read is poll driven and uinput writes complete inline
+// while being submitted, no io-wq worker threads. To keep frames in order only
+// one write is in flight, further frames are merged into the other buffer.
+#define URING_BATCH 64                  // events per pre-posted read
+#define WBUF_MAX    (2*FRAME_MAX)       // events per write buffer
+#define UD_READ     1
+#define UD_SIGNAL   2
+#define UD_TIMER    3
+#define UD_WRITE    4
+
+typedef struct {
+    struct input_event evts[WBUF_MAX];
+    struct timeval ftime[WBUF_MAX];     // real sync timestamp of each frame
+    struct timeval sent;                // when handed to the ring
+    int len;
+    int frames;
+    size_t off;                         // bytes written so far
+} wbuf_t;
+
+// queue (the rest of) a write buffer to uinput
+static void uring_write(uring_t *ur, fakeev_t *fe, wbuf_t *wb) {
+    gettimeofday(&wb->sent, NULL);
+    uring_prep(ur, IORING_OP_WRITE, fe->uifd, (char *)wb->evts + wb->off,
+        wb->len*sizeof(wb->evts[0]) - wb->off, UD_WRITE);
+}
+
+static int uring_engine(fakeev_t *fe) {
+    static struct input_event rbuf[URING_BATCH];
+    static wbuf_t wbuf[2];
+    int fill = 0;                       // buffer collecting frames
+    int busy = 0;                       // other buffer being written
+    int dirty = 0;
+    uring_t ur;
+    // plenty: at most a read, signal, timer & one write queued at once
+    if (uring_init(&ur, 8)<0) {
+        perror("io_uring_setup");
+        return -1;
+    }
+    if (uring_probe(&ur)<0) {
+        perror("io_uring_register(PROBE)");
+        uring_exit(&ur);
+        return -1;
+    }
+    // foreground - Ctrl-C arrives on the ring rather than via trap()
+    int sigfd = -1;
+    struct signalfd_siginfo si;
+    struct __kernel_timespec tick = { .tv_sec = 0, .tv_nsec = 100000000 };
+    if (!fe->backgnd) {
+        sigset_t ss;
+        sigemptyset(&ss);
+        sigaddset(&ss, SIGINT);
+        sigfd = signalfd(-1, &ss, 0);
+        if (sigfd<0) {
+            perror("signalfd");
+            uring_exit(&ur);
+            return -1;
+        }
+        sigprocmask(SIG_BLOCK, &ss, NULL);
+        uring_prep(&ur, IORING_OP_READ, sigfd, &si, sizeof(si), UD_SIGNAL);
+        uring_prep(&ur, IORING_OP_TIMEOUT, -1, &tick, 1, UD_TIMER)->off = 0;
+    }
+    // poll driven reads, rather than a worker thread blocked in read()
+    fcntl(fe->evfd, F_SETFL, fcntl(fe->evfd, F_GETFL) | O_NONBLOCK);
+    uring_prep(&ur, IORING_OP_READ, fe->evfd, rbuf, sizeof(rbuf), UD_READ);
+    while (!done) {
+        // while a write is outstanding, reap its completion on the same
+        // wakeup as the next read rather than waking up for it separately
+        fe->syscalls++;
+        if (uring_enter(&ur, busy ? 2 : 1)<0) {
+            if (EINTR==errno)
+                continue;
+            perror("io_uring_enter");
+            break;
+        }
+        unsigned head = *ur.cq_head;
+        unsigned tail = __atomic_load_n(ur.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head!=tail; head++) {
+            struct io_uring_cqe *cqe = ur.cqes + (head & *ur.cq_mask);
+            __u64 ud = cqe->user_data;
+            int res = cqe->res;
+            if (UD_READ==ud) {
+                if (-EAGAIN==res) {
+                    uring_prep(&ur, IORING_OP_READ, fe->evfd, rbuf, sizeof(rbuf), UD_READ);
+                    continue;
+                }
+                if (res<=0) {
+                    errno = res ? -res : EIO;
+                    perror("reading event");
+                    done = 1;
+                    continue;
+                }
+                wbuf_t *wb = wbuf+fill;
+                for (int i=0; i<res/(int)sizeof(rbuf[0]); i++) {
+                    if (!accumulate(fe, rbuf+i))
+                        continue;
+                    dirty = 1;
+                    // no room for a frame, leave it accumulated for next sync
+                    if (wb->len+FRAME_MAX>WBUF_MAX) {
+                        puts("uinput overflow");
+                        continue;
+                    }
+                    int n = sync_frame(fe, wb->evts+wb->len);
+                    if (n) {
+                        wb->ftime[wb->frames++] = rbuf[i].time;
+                        wb->len += n;
+                    }
+                }
+                uring_prep(&ur, IORING_OP_READ, fe->evfd, rbuf, sizeof(rbuf), UD_READ);
+            } else if (UD_SIGNAL==ud) {
+                fprintf(stderr, "SIG:%d\n", si.ssi_signo);
+                done = 1;
+            } else if (UD_TIMER==ud) {
+                if (dirty)
+                    show_status(fe);
+                dirty = 0;
+                uring_prep(&ur, IORING_OP_TIMEOUT, -1, &tick, 1, UD_TIMER)->off = 0;
+            } else if (UD_WRITE==ud) {
+                wbuf_t *wb = wbuf+(fill^1);
+                if (-EAGAIN==res) {
+                    puts("uinput overflow");
+                } else if (res<0) {
+                    errno = -res;
+                    perror("writing uinput");
+                    done = 1;
+                } else if (wb->off+res < wb->len*sizeof(wb->evts[0])) {
+                    // short write, push out the rest before anything newer
+                    wb->off += res;
+                    uring_write(&ur, fe, wb);
+                    continue;
+                } else {
+                    // completed inline while being submitted, but may only be
+                    // reaped with the next read, so take latency at hand-off
+                    for (int f=0; f<wb->frames; f++)
+                        account_latency(fe, wb->ftime+f, &wb->sent);
+                }
+                wb->len = wb->frames = 0;
+                wb->off = 0;
+                busy = 0;
+            }
+        }
+        __atomic_store_n(ur.cq_head, head, __ATOMIC_RELEASE);
+        // start writing collected frames if the previous write is done
+        if (!busy && wbuf[fill].len) {
+            uring_write(&ur, fe, wbuf+fill);
+            busy = 1;
+            fill ^= 1;
+        }
+    }
+    if (sigfd>=0)
+        close(sigfd);
+    uring_exit(&ur);
     return 0;
 }
 
 int main(int argc, char **argv) {
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
     char *evdev = "/dev/input/by-id/usb-Logitech_Logitech_Freedom_2.4-event-joystick";
     char *fake = "[Fakejoy] Logitech Freedom 2.4";
     char *logf = "/tmp/fakeev.log";
+    char *cachef = "/var/cache/fakeev.profile";
     int backgnd = 0;
+    int verbose = 0;
+    int stats = 0;
+    char *engine = "read";
     for (int a=1; a<argc; a++) {
         if (strncmp(argv[a],"-d",2)==0)
             evdev = argv[++a];
@@ -78,8 +684,16 @@ int main(int argc, char **argv) {
             backgnd = 1;
         else if (strncmp(argv[a],"-l",2)==0)
             logf = argv[++a];
+        else if (strncmp(argv[a],"-c",2)==0)
+            cachef = argv[++a];
+        else if (strncmp(argv[a],"-v",2)==0)
+            verbose = 1;
+        else if (strncmp(argv[a],"-e",2)==0 && a+1<argc && (strcmp(argv[a+1],"read")==0 || strcmp(argv[a+1],"uring")==0))
+            engine = argv[++a];
+        else if (strncmp(argv[a],"-s",2)==0)
+            stats = 1;
         else
-            return printf("usage: %s [-b [-l <logfile:%s>]] [-d <real device:%s>] [-f <fake device:%s>]\n", argv[0], logf, evdev, fake);
+            return printf("usage: %s [-b [-l <logfile:%s>]] [-v] [-s] [-e <engine read|uring:%s>] [-c <profile cache:%s>] [-d <real device:%s>] [-f <fake device:%s>]\n", argv[0], logf, engine, cachef, evdev, fake);
     }
     if (backgnd) {
         // fork/detach ourselves
@@ -105,19 +719,28 @@ int main(int argc, char **argv) {
         perror("opening /dev/uinput");
         return 1;
     }
-    // set fake device name and bus id
-    char name[128];
-    int nlen=ioctl(evfd, EVIOCGNAME(sizeof(name)), name);
-    if (nlen<0) {
-        perror("reading device name");
+    // identify real device, this is the key for the profile cache
+    profile_t prof;
+    memset(&prof, 0, sizeof(prof));
+    if (read_key(evfd, &prof))
         return 1;
-    }
-    printf("real device name: %.*s\n", nlen, name);
-    struct uinput_setup setup;
-    if (ioctl(evfd, EVIOCGID, &setup.id)<0) {
-        perror("reading real bus id");
+    // use cached capabilities if we have them, otherwise probe & cache
+    int cached = load_profile(cachef, &prof);
+    int stale = 0;
+    if (cached) {
+        // axis info is cheap to read & can be recalibrated (EVIOCSABS), so
+        // always take it live: current values, and a check on cached ranges
+        stale = probe_axes(evfd, &prof);
+        if (stale<0)
+            return 1;
+        if (stale)
+            puts("cached axis info differs from real device, updating profile");
+    } else if (probe_profile(evfd, &prof)) {
         return 1;
     }
+    // set fake device name and bus id
+    struct uinput_setup setup;
+    setup.id = prof.id;
     strncpy(setup.name, fake, UINPUT_MAX_NAME_SIZE);
     setup.id.bustype = BUS_VIRTUAL;     // Not a USB device, otherwise identical :=)
     setup.ff_effects_max = 0;           // No force feedback please!
@@ -126,149 +749,47 @@ int main(int argc, char **argv) {
         return 1;
     }
     printf("fake device name: %s\n", fake);
-    // read capabilities, copy to fake device
-    // we use KEY_CNT for array size here as it's the largest thing
-    char bits[KEY_CNT];
-    int blen;
-    int blist[] = {0, EV_ABS, EV_KEY, EV_MAX, -1};
-    int uiioc[] = {UI_SET_EVBIT, UI_SET_ABSBIT, UI_SET_KEYBIT, UI_SET_PROPBIT};
-    int naxes;
-    char axes[ABS_CNT];
-    for (int b=0; blist[b]!=-1; b++) {
-        if (EV_MAX==blist[b])
-            blen = ioctl(evfd, EVIOCGPROP(sizeof(bits)), bits);
-        else
-            blen = ioctl(evfd, EVIOCGBIT(blist[b],sizeof(bits)), bits);
-        if (blen<0) {
-            perror("reading real device bits");
-            return 1;
-        }
-        printf("copy bits(%d)=%d: ", blist[b], blen);
-        for (int o=0; o<blen*8; o++) {
-            if (bits[o/8] & (1<<(o%8))) {
-                printf("%02x,", o);
-                if (ioctl(uifd, uiioc[b], o)<0) {
-                    perror("ioctl(UI_SET_XX)");
-                    return 1;
-                }
-            }
-        }
-        puts("");
-        // save axes bits for later
-        if (EV_ABS==blist[b]) {
-            naxes = blen;
-            memcpy(axes, bits, naxes);
-        }
-    }
-    // accumulated state & deadzones
-    joystate_t joy = {0};
-    deadzone_t zones[ABS_CNT];
-    memset(zones, 0, sizeof(zones));
-    // read axis info, pre-populate values, calculate deadzones
-    for (int a=0; a<naxes*8; a++) {
-        if (axes[a/8] & (1<<a%8)) {
-            struct uinput_abs_setup abs_setup;
-            if (ioctl(evfd, EVIOCGABS(a), &abs_setup.absinfo)<0) {
-                perror("reading axis info");
-                return 1;
-            }
-            abs_setup.code = a;
-            if (ioctl(uifd, UI_ABS_SETUP, &abs_setup)<0) {
-                perror("ioctl(UI_ABS_SETUP)");
-                return 1;
-            }
-            joy.axes[a] = abs_setup.absinfo.value;
-            zones[a].min = abs_setup.absinfo.minimum;
-            zones[a].max = abs_setup.absinfo.maximum;
-            zones[a].dlow = (abs_setup.absinfo.minimum+abs_setup.absinfo.maximum)/2-abs_setup.absinfo.flat;
-            zones[a].dhigh = (abs_setup.absinfo.minimum+abs_setup.absinfo.maximum)/2+abs_setup.absinfo.flat;
-            printf("axis[%d]: min=%d max=%d fuzz=%d flat=%d: dlow=%d dhigh=%d\n", a,
-                abs_setup.absinfo.minimum,
-                abs_setup.absinfo.maximum,
-                abs_setup.absinfo.fuzz,
-                abs_setup.absinfo.flat,
-				zones[a].dlow, zones[a].dhigh);
-        }
-    }
+    // copy capabilities & axis info to fake device
+    if (apply_profile(uifd, &prof, verbose))
+        return 1;
     // create the fake device!
     if (ioctl(uifd, UI_DEV_CREATE)<0) {
         perror("creating fake device");
         return 1;
     }
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("fake device created in %.3fms (%s profile)\n",
+        (t1.tv_sec-t0.tv_sec)*1e3 + (t1.tv_nsec-t0.tv_nsec)/1e6, cached ? "cached" : "probed");
+    // (re)write the cache now the fake device is up, not on the way
+    if ((!cached || stale) && save_profile(cachef, &prof))
+        printf("unable to save profile cache: %s\n", cachef);
+    // accumulated state & deadzones
+    fakeev_t fe;
+    memset(&fe, 0, sizeof(fe));
+    fe.evfd = evfd;
+    fe.uifd = uifd;
+    fe.backgnd = backgnd;
+    fe.zones = prof.zones;
+    // pre-populate axis values (read live above, cached or not)
+    for (int a=0; a<ABS_CNT; a++) {
+        if (TESTBIT(prof.bits[1], a))
+            fe.joy.axes[a] = prof.absinfo[a].value;
+    }
+    // fake a SYN to push initial state out
+    static struct input_event frame[FRAME_MAX];
+    int n = sync_frame(&fe, frame);
+    if (n && send_frame(&fe, frame, n))
+        return 1;
     // read events, update accumulated state..
-    joystate_t pjoy = {0};
-    int first = 1;
-    while (!done) {
-        struct input_event evt;
-        if (first) {
-            // fake a SYN to push initial state out
-            first = 0;
-            evt.type = EV_SYN;
-            evt.code = 0;
-            evt.value = 0;
-        } else if (read(evfd, &evt, sizeof(evt))!=sizeof(evt)) {
-            if (!done)
-                perror("reading event");
-            break;
-        }
-        switch (evt.type) {
-        // drop through to sync logic
-        case EV_SYN:
-            break;
-        // update accumulated state, go round again
-        case EV_ABS:
-            joy.axes[evt.code % ABS_CNT] = evt.value;
-            continue;
-        case EV_KEY:
-            joy.keys[evt.code % KEY_CNT] = (__u8)evt.value;
-            continue;
-        // siliently ignore these, we get one after each key press/release
-        case EV_MSC:
-            continue;
-        // eh?
-        default:
-            printf("ignored event: type=0x%x code=0x%x value=%d\n", evt.type, evt.code, evt.value);
-            continue;
-        }
-        // EV_SYN arrived, check for magic offline values
-        // X & Y within +/-2 of centre (512), rudder centre (128) throttle full (0)
-        if (510<=joy.axes[ABS_X] && joy.axes[ABS_X]<=514 &&
-            510<=joy.axes[ABS_Y] && joy.axes[ABS_Y]<=514 &&
-            128==joy.axes[ABS_RZ] && 0==joy.axes[ABS_THROTTLE]) {
-            joy.offline = 1;
-        } else {
-            joy.offline = 0;
-        }
-        // push modified values to uinput unless offline
-        if (!joy.offline) {
-            for (int a=0; a<ABS_CNT; a++) {
-                if (pjoy.axes[a] != joy.axes[a]) {
-                    pjoy.axes[a] = joy.axes[a];
-                    if (send_event(uifd, EV_ABS, a, deadzone(zones, a, pjoy.axes[a])))
-                        done = 1;
-                }
-            }
-            for (int k=0; k<KEY_CNT; k++) {
-                if (pjoy.keys[k] != joy.keys[k]) {
-                    pjoy.keys[k] = joy.keys[k];
-                    if (send_event(uifd, EV_KEY, k, pjoy.keys[k]))
-                        done = 1;
-                }
-            }
-            // push SYN to flush out
-            send_event(uifd, EV_SYN, SYN_REPORT, 0);
-        }
-        if (!backgnd) printf("X:%04d Y:%04d R:%03d T:%03d B:%d%d%d%d%d%d%d%d%d%d H:%c%c O:%d\r",
-            deadzone(zones, ABS_X, pjoy.axes[ABS_X]),
-            deadzone(zones, ABS_Y, pjoy.axes[ABS_Y]),
-            deadzone(zones, ABS_RZ, pjoy.axes[ABS_RZ]),
-            deadzone(zones, ABS_THROTTLE, pjoy.axes[ABS_THROTTLE]),
-            pjoy.keys[BTN_TRIGGER], pjoy.keys[BTN_THUMB], pjoy.keys[BTN_THUMB2],
-            pjoy.keys[BTN_TOP], pjoy.keys[BTN_TOP2], pjoy.keys[BTN_PINKIE],
-            pjoy.keys[BTN_BASE], pjoy.keys[BTN_BASE2], pjoy.keys[BTN_BASE3], pjoy.keys[BTN_BASE4],
-            '='+pjoy.axes[ABS_HAT0X], '='+pjoy.axes[ABS_HAT0Y], joy.offline);
-            fflush(stdout);
+    if (strcmp(engine, "uring")==0 && uring_engine(&fe)<0) {
+        puts("io_uring unavailable, falling back to read engine");
+        engine = "read";
     }
+    if (strcmp(engine, "uring")!=0)
+        read_engine(&fe);
+    if (stats)
+        show_stats(&fe, engine);
     ioctl(uifd, UI_DEV_DESTROY);
     close(uifd);
     close(evfd);